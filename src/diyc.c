@@ -38,6 +38,13 @@
 #include <fts.h>
 #include <dirent.h>
 #include <getopt.h>
+#include <stdarg.h>
+#include <sys/file.h>
+#include <sys/vfs.h>
+#include <linux/magic.h>
+#include <net/if.h>
+
+#include "seccomp.h"
 
 #ifndef FALSE
 # define FALSE 0
@@ -51,6 +58,8 @@
 #define BRIDGE "diyc0"
 #define IPLEN 16
 #define IMAGELEN 127
+#define POOL_MAX 50 /* Network namespaces in the pool */
+#define POOL_IP_BASE 200 /* Pool slot n has 172.16.0.<POOL_IP_BASE + n> */
 
 const char *domain = "diyc";
 
@@ -76,6 +85,10 @@ typedef struct container {
     char path[PATH_MAX + 1]; /* Container fs directory  $(PWD)/containers/<id>*/
     char ip[IPLEN + 1]; /*IP address of the container */
     char image[IMAGELEN + 1]; /* Path of the conatiner image $(PWD)/images/<image> */
+    struct sock_fprog seccomp; /* Compiled syscall filter, empty if no profile */
+    int pool_slot; /* Pooled network namespace slot, -1 if not pooled */
+    int pool_lock; /* Lock held on the slot while the container runs */
+    int netns_fd; /* Pooled network namespace to join, -1 if none */
 } container_t;
 
 struct clone_stack {
@@ -88,18 +101,32 @@ usage(char *name)
 {
     printf("Execute a naive container environment.\n");
     printf("See https://github.com/w-vi/diyc for more information.\n\n");
-    printf("Usage: %s [hv][-m NUMBER] [-ip IPV4 ADDRESS] <NAME> <IMAGE> <CMD>\n\n", name);
+    printf("Usage: %s [hpv][-m NUMBER] [-ip IPV4 ADDRESS] <NAME> <IMAGE> <CMD>\n\n", name);
 
     printf("\
     -h, --help           print this help\n\n");
     printf("\
     -i, --ip             ip address of the container, if not set then host \n\
                          network is used. It must be in the 172.16.0/16 network \n\
-                         as the bridge diyc0 is 172.16.0.1\n\n");
+                         as the bridge diyc0 is 172.16.0.1, 172.16.0.200-249 is\n\
+                         reserved for the network namespace pool\n\n");
     printf("\
     -m, --mem            maximum size of the memory in MB allowed for the container\n\
                          by default there no explicit limit defined.\n\n");
 
+    printf("\
+    -p, --pool           join a pre-created network namespace from the pool instead\n\
+                         of creating a new one. If --ip is not set the address of\n\
+                         the pool slot is used, slot n has 172.16.0.(200 + n).\n\
+                         A new slot is created if none is free and it is recycled\n\
+                         rather than destroyed on exit.\n\n");
+
+    printf("\
+    --pool-create N      create N new network namespaces in the pool and exit\n\n");
+
+    printf("\
+    --pool-destroy       destroy all unused network namespaces in the pool and exit\n\n");
+
     printf("\
     -v, --verbose        more verbose output\n\n");
 
@@ -108,7 +135,8 @@ usage(char *name)
 
     printf("\
     <IMAGE>              image to be used for the container, must be a directory name\n\
-                         under the images directory\n\n");
+                         under the images directory. If images/<IMAGE>.seccomp\n\
+                         exists it is used as the syscall allowlist\n\n");
 
     printf("\
     <CMD>                command to be executed inside the container\n");
@@ -301,6 +329,911 @@ network_setup(pid_t pid)
     return 0;
 }
 
+/* Run fn(arg) inside the network namespace nsfd. Forks so that the
+ * caller stays in its own namespace. Returns 0 if fn returned 0.
+ */
+static int
+netns_call(int nsfd, int (*fn)(void *), void *arg)
+{
+    pid_t pid;
+    int status;
+
+    if ((pid = fork()) < 0) die("fork netns_call");
+
+    if (pid == 0) {
+        if (setns(nsfd, CLONE_NEWNET) < 0) die("setns");
+        _exit(fn(arg) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    if (waitpid(pid, &status, 0) == -1) die("waitpid netns_call");
+
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+/* Run a tool with input fed to its stdin, without a shell in between.
+ * Meant for the batch modes of ip and tc which run a whole list of
+ * commands in one process. Output goes to /dev/null, errors too if
+ * quiet. Returns the exit status of the tool, 127 if it is not there.
+ */
+static int
+run_tool(char *const argv[], const char *input, int quiet)
+{
+    pid_t pid;
+    int status;
+    int fd[2];
+    int null;
+
+    if (pipe(fd) == -1) return -1;
+
+    if ((pid = fork()) < 0) {
+        close(fd[0]);
+        close(fd[1]);
+        return -1;
+    }
+
+    if (pid == 0) {
+        close(fd[1]);
+        dup2(fd[0], STDIN_FILENO);
+        if ((null = open("/dev/null", O_WRONLY)) >= 0) {
+            dup2(null, STDOUT_FILENO);
+            if (quiet) dup2(null, STDERR_FILENO);
+        }
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+
+    close(fd[0]);
+    /* The tool may be gone already, don't die on SIGPIPE then */
+    signal(SIGPIPE, SIG_IGN);
+    write(fd[1], input, strlen(input));
+    close(fd[1]);
+
+    if (waitpid(pid, &status, 0) == -1) return -1;
+
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+/* Run the printf like list of ip commands, one per line, in a single
+ * "ip -batch" process. It stops at the first command which fails. */
+static int
+ip_batch(const char *fmt, ...)
+{
+    char *const argv[] = { "ip", "-batch", "-", NULL };
+    char *cmds;
+    va_list ap;
+    int err;
+
+    va_start(ap, fmt);
+    vasprintf(&cmds, fmt, ap);
+    va_end(ap);
+
+    err = run_tool(argv, cmds, FALSE);
+    free(cmds);
+
+    return err == 0 ? 0 : -1;
+}
+
+/* Network namespace pool.
+ *
+ * Creating a network namespace is slow and destroying it is even
+ * worse, the kernel tears them down one by one. So instead of a new
+ * namespace per container we keep a pool of them which outlive the
+ * containers. Every slot is a namespace kept alive by bind mounting
+ * its nsfs file to $(PWD)/netns/<slot>, with veth pair already
+ * attached to the bridge and addressed. Slots are claimed by flock(2)
+ * on $(PWD)/netns/<slot>.lock so concurrent diyc runs don't share one,
+ * $(PWD)/netns/<slot>.busy exists while a slot is in use. The sysctls
+ * of a fresh slot are saved to $(PWD)/netns/<slot>.sysctl so they can
+ * be restored when the slot is recycled.
+ */
+static void
+pool_path(int slot, char *path, const char *suffix)
+{
+    if (snprintf(path,
+                 PATH_MAX,
+                 "%s/netns/%d%s",
+                 cwd,
+                 slot,
+                 suffix) >= PATH_MAX) die("snprintf: netns path");
+}
+
+/* Own address of the slot, POOL_MAX keeps it within the bridge network */
+static void
+pool_ip(int slot, char *ip)
+{
+    snprintf(ip, IPLEN, "172.16.0.%u", (unsigned char)(POOL_IP_BASE + slot));
+}
+
+/* Pool slot addresses can't be used by other containers */
+static int
+pool_ip_reserved(const char *ip)
+{
+    unsigned int a, b, c, d;
+
+    if (sscanf(ip, "%u.%u.%u.%u", &a, &b, &c, &d) != 4) return FALSE;
+
+    return a == 172 && b == 16 && c == 0 &&
+        d >= POOL_IP_BASE && d < POOL_IP_BASE + POOL_MAX;
+}
+
+/* Open the namespace of the slot, -1 if there is none. */
+static int
+pool_open_ns(int slot)
+{
+    char path[PATH_MAX + 1];
+    struct statfs fs;
+    int fd;
+
+    pool_path(slot, path, "");
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) return -1;
+
+    /* Just a file if the bind mount is not there */
+    if (fstatfs(fd, &fs) < 0 || fs.f_type != NSFS_MAGIC) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/* Open the namespace of a slot ready to use, -1 if the slot was not
+ * created or its creation didn't finish. The sysctl snapshot is
+ * written as the last step of pool_create() and marks the slot ready.
+ */
+static int
+pool_open(int slot)
+{
+    char path[PATH_MAX + 1];
+
+    pool_path(slot, path, ".sysctl");
+    if (access(path, F_OK) < 0) return -1;
+
+    return pool_open_ns(slot);
+}
+
+/* Quick check without the lock, only a hint as the slot can change
+ * until it is locked. */
+static int
+pool_exists(int slot)
+{
+    int fd = pool_open(slot);
+
+    if (fd < 0) return FALSE;
+    close(fd);
+    return TRUE;
+}
+
+/* Try to lock the slot, -1 if it is in use by another container. The
+ * lock file is removed when a slot is destroyed, so make sure the
+ * locked file is still the one in the directory, otherwise someone
+ * else could lock a new file of the same name at the same time. */
+static int
+pool_lock(int slot)
+{
+    char path[PATH_MAX + 1];
+    struct stat fst, pst;
+    int fd;
+
+    pool_path(slot, path, ".lock");
+    if ((fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600)) < 0) die("open pool lock");
+
+    if (flock(fd, LOCK_EX | LOCK_NB) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    if (fstat(fd, &fst) < 0 || stat(path, &pst) < 0 ||
+        fst.st_ino != pst.st_ino || fst.st_dev != pst.st_dev) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/* ip commands (re)setting the address of the slot and the default
+ * route via the bridge. Whatever was there before is flushed. */
+#define POOL_ADDRESS_CMDS                       \
+    "addr flush dev veth1\n"                    \
+    "addr add %s/24 dev veth1\n"                \
+    "route replace default via 172.16.0.1\n"
+
+static int
+pool_address_ns(void *ip)
+{
+    return ip_batch(POOL_ADDRESS_CMDS, (char *)ip);
+}
+
+static int
+pool_address(int nsfd, const char *ip)
+{
+    return netns_call(nsfd, pool_address_ns, (void *)ip);
+}
+
+/* Read a sysctl value, only single line values are handled. */
+static int
+sysctl_read(const char *path, char *val, size_t size)
+{
+    ssize_t len;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) < 0) return -1;
+    len = read(fd, val, size - 1);
+    close(fd);
+
+    if (len <= 0) return -1;
+    val[len] = '\0';
+
+    if (strchr(val, '\n') != val + len - 1) return -1;
+    return 0;
+}
+
+/* Save every writable setting under dir as "<path> <value>" lines. */
+static void
+sysctl_walk(const char *dir, FILE *fp)
+{
+    char path[PATH_MAX + 1];
+    char val[4096];
+    struct dirent *e;
+    struct stat st;
+    DIR *d;
+
+    if (NULL == (d = opendir(dir))) return;
+
+    while ((e = readdir(d))) {
+        if (e->d_name[0] == '.') continue;
+        if (snprintf(path, PATH_MAX, "%s/%s", dir, e->d_name) >= PATH_MAX) continue;
+        if (lstat(path, &st) < 0) continue;
+
+        if (S_ISDIR(st.st_mode)) {
+            sysctl_walk(path, fp);
+        } else if ((st.st_mode & S_IRUSR) && (st.st_mode & S_IWUSR) &&
+                   sysctl_read(path, val, sizeof(val)) == 0) {
+            fprintf(fp, "%s %s", path, val);
+        }
+    }
+
+    closedir(d);
+}
+
+/* Snapshot the sysctls of the namespace. The /proc/sys/net view
+ * follows the network namespace of the reader. */
+static int
+sysctl_save(const char *file)
+{
+    FILE *fp;
+
+    if (NULL == (fp = fopen(file, "w"))) return -1;
+    sysctl_walk("/proc/sys/net", fp);
+    return fclose(fp) == 0 ? 0 : -1;
+}
+
+/* Write back the saved values which differ, returns the number of
+ * values which differed or -1 on error. The snapshot is grouped by
+ * directory, so the files are opened relative to the directory which
+ * spares a full path lookup in /proc for every one of them. */
+static int
+sysctl_restore_pass(const char *file)
+{
+    char dir[PATH_MAX + 1] = "";
+    char cur[4096];
+    char *line = NULL;
+    size_t n = 0;
+    int changed = 0;
+    int dfd = -1;
+    FILE *fp;
+
+    if (NULL == (fp = fopen(file, "r"))) return -1;
+
+    while (getline(&line, &n, fp) > 0) {
+        char *val = strchr(line, ' ');
+        char *name;
+        ssize_t len;
+        int fd;
+
+        if (NULL == val) continue;
+        *val++ = '\0';
+        if (NULL == (name = strrchr(line, '/'))) continue;
+        *name++ = '\0';
+
+        if (strcmp(dir, line) != 0) {
+            if (dfd >= 0) close(dfd);
+            snprintf(dir, sizeof(dir), "%s", line);
+            dfd = open(dir, O_RDONLY | O_DIRECTORY);
+        }
+
+        if (dfd < 0 || (fd = openat(dfd, name, O_RDWR)) < 0) {
+            changed = -1;
+            break;
+        }
+
+        len = read(fd, cur, sizeof(cur) - 1);
+        if (len <= 0) {
+            close(fd);
+            changed = -1;
+            break;
+        }
+        cur[len] = '\0';
+
+        if (strcmp(cur, val) != 0) {
+            changed++;
+            pwrite(fd, val, strlen(val), 0);
+        }
+        close(fd);
+    }
+
+    if (dfd >= 0) close(dfd);
+    free(line);
+    fclose(fp);
+    return changed;
+}
+
+/* Restore the saved sysctls. Some settings like net.ipv4.conf.all
+ * change others when written, so repeat until nothing differs anymore
+ * or give up. */
+static int
+sysctl_restore(const char *file)
+{
+    int round, changed;
+
+    for (round = 0; round < 4; round++) {
+        if ((changed = sysctl_restore_pass(file)) <= 0) return changed;
+    }
+
+    return -1;
+}
+
+/* Slot reset.
+ *
+ * Recycling a slot has to be cheaper than a fresh namespace, so the
+ * whole reset runs in one child inside the namespace. The changes are
+ * made by a few "ip -batch" style processes rather than a command per
+ * setting, and features the host doesn't have are skipped instead of
+ * failing. A step only fails if the namespace can't be brought back
+ * to the state of a fresh slot, the slot is destroyed then.
+ */
+typedef struct pool_reset {
+    const char *ip;      /* Address of the slot */
+    const char *sysctls; /* Sysctl snapshot of the fresh slot */
+} pool_reset_t;
+
+static int
+is_slot_link(const char *name)
+{
+    return strcmp(name, "lo") == 0 || strcmp(name, "veth1") == 0;
+}
+
+/* Count the links the container added, -1 if lo or veth1 is gone. */
+static int
+extra_links(char *cmds, size_t size)
+{
+    struct if_nameindex *ifs, *i;
+    int found = 0;
+    int extra = 0;
+    size_t len = 0;
+
+    if (NULL == (ifs = if_nameindex())) return -1;
+
+    for (i = ifs; i->if_index != 0; i++) {
+        if (is_slot_link(i->if_name)) {
+            found++;
+            continue;
+        }
+        extra++;
+        if (cmds && len < size) {
+            len += snprintf(cmds + len, size - len, "link delete dev %s\n", i->if_name);
+        }
+    }
+
+    if_freenameindex(ifs);
+
+    return found == 2 ? extra : -1;
+}
+
+/* Delete the links the container added. Deleting one end of a veth
+ * pair takes the other with it, so errors are ignored and only what
+ * is left afterwards counts. */
+static int
+reset_links(const pool_reset_t *r)
+{
+    char *const argv[] = { "ip", "-force", "-batch", "-", NULL };
+    char cmds[4096];
+    int extra;
+
+    (void)r;
+
+    if ((extra = extra_links(cmds, sizeof(cmds))) <= 0) return extra;
+
+    run_tool(argv, cmds, TRUE);
+
+    return extra_links(NULL, 0) == 0 ? 0 : -1;
+}
+
+static int
+reset_sysctls(const pool_reset_t *r)
+{
+    return sysctl_restore(r->sysctls) < 0 ? -1 : 0;
+}
+
+/* Addresses, routes and rules of both families, neighbours, IPsec
+ * and the link settings, then the slot address as in a fresh slot.
+ * Flushing without a family covers both, except for the rules. */
+static int
+reset_ip(const pool_reset_t *r)
+{
+    /* Without XFRM the kernel has no IPsec state to flush */
+    int xfrm = access("/proc/sys/net/core/xfrm_acq_expires", F_OK) == 0;
+
+    return ip_batch("link set dev lo down\n"
+                    "link set dev veth1 down\n"
+                    "addr flush dev lo\n"
+                    "addr flush dev veth1\n"
+                    "route flush table all\n"
+                    "rule flush\n"
+                    "rule add pref 32766 lookup main\n"
+                    "rule add pref 32767 lookup default\n"
+                    "neigh flush all\n"
+                    "%s"
+                    "link set dev lo mtu 65536 up\n"
+                    "link set dev veth1 mtu 1500 up\n"
+                    "addr replace 127.0.0.1/8 dev lo\n"
+                    POOL_ADDRESS_CMDS,
+                    xfrm ? "xfrm state flush\nxfrm policy flush\n" : "",
+                    r->ip);
+}
+
+/* IPv6 rules can only be flushed on their own, skipped if the host
+ * has IPv6 disabled. */
+static int
+reset_ip6_rules(const pool_reset_t *r)
+{
+    char *const argv[] = { "ip", "-6", "-batch", "-", NULL };
+
+    (void)r;
+
+    if (access("/proc/sys/net/ipv6", F_OK) < 0) return 0;
+
+    return run_tool(argv,
+                    "rule flush\n"
+                    "rule add pref 32766 lookup main\n",
+                    FALSE) == 0 ? 0 : -1;
+}
+
+/* Deleting the default qdisc is an error, so errors are ignored. */
+static int
+reset_qdiscs(const pool_reset_t *r)
+{
+    char *const argv[] = { "tc", "-force", "-batch", "-", NULL };
+
+    (void)r;
+
+    run_tool(argv,
+             "qdisc del dev veth1 root\n"
+             "qdisc del dev veth1 ingress\n"
+             "qdisc del dev lo root\n"
+             "qdisc del dev lo ingress\n",
+             TRUE);
+    return 0;
+}
+
+/* Only if there is anything tracked. Entries time out on their own, so
+ * without the conntrack tool or if it fails this is just a warning. */
+static int
+reset_conntrack(const pool_reset_t *r)
+{
+    char *const argv[] = { "conntrack", "-F", NULL };
+    char count[32];
+
+    (void)r;
+
+    if (sysctl_read("/proc/sys/net/netfilter/nf_conntrack_count",
+                    count, sizeof(count)) < 0 || atoi(count) == 0) return 0;
+
+    if (run_tool(argv, "", TRUE) != 0) {
+        fprintf(stderr, "Could not flush conntrack table of the pool slot\n");
+    }
+    return 0;
+}
+
+/* Built-in chains of the iptables tables */
+static const struct {
+    const char *table;
+    const char *chains;
+} ipt_chains[] = {
+    { "filter",   "INPUT FORWARD OUTPUT" },
+    { "nat",      "PREROUTING INPUT OUTPUT POSTROUTING" },
+    { "mangle",   "PREROUTING INPUT FORWARD OUTPUT POSTROUTING" },
+    { "raw",      "PREROUTING OUTPUT" },
+    { "security", "INPUT FORWARD OUTPUT" },
+};
+
+#define IPT_TABLES (int)(sizeof(ipt_chains) / sizeof(ipt_chains[0]))
+
+/* Empty every table listed in names with one iptables-restore run,
+ * built-in chains get back the ACCEPT policy. Nothing to do if no
+ * table is in use, but rules without a tool to flush them are an
+ * error. */
+static int
+reset_ipt_family(const char *names, const char *legacy, const char *tool)
+{
+    char *argv[] = { NULL, NULL };
+    char input[4096];
+    char table[64];
+    size_t len = 0;
+    FILE *fp;
+    int i, err;
+
+    if (NULL == (fp = fopen(names, "r"))) return 0;
+
+    while (fscanf(fp, "%63s", table) == 1 && len < sizeof(input)) {
+        len += snprintf(input + len, sizeof(input) - len, "*%s\n", table);
+        for (i = 0; i < IPT_TABLES; i++) {
+            const char *ch = ipt_chains[i].chains;
+
+            if (strcmp(ipt_chains[i].table, table) != 0) continue;
+
+            while (*ch && len < sizeof(input)) {
+                size_t n = strcspn(ch, " ");
+
+                len += snprintf(input + len, sizeof(input) - len,
+                                ":%.*s ACCEPT [0:0]\n", (int)n, ch);
+                ch += n + (ch[n] == ' ');
+            }
+        }
+        if (len < sizeof(input)) {
+            len += snprintf(input + len, sizeof(input) - len, "COMMIT\n");
+        }
+    }
+    fclose(fp);
+
+    if (len == 0) return 0;
+    if (len >= sizeof(input)) return -1;
+
+    /* /proc lists the legacy tables, prefer the tool which is surely
+     * legacy as well */
+    argv[0] = (char *)legacy;
+    if ((err = run_tool(argv, input, FALSE)) == 127) {
+        argv[0] = (char *)tool;
+        err = run_tool(argv, input, FALSE);
+    }
+
+    return err == 0 ? 0 : -1;
+}
+
+static int
+reset_iptables(const pool_reset_t *r)
+{
+    (void)r;
+
+    if (reset_ipt_family("/proc/net/ip_tables_names",
+                         "iptables-legacy-restore", "iptables-restore") < 0) return -1;
+
+    return reset_ipt_family("/proc/net/ip6_tables_names",
+                            "ip6tables-legacy-restore", "ip6tables-restore");
+}
+
+/* Only if nf_tables is loaded on the host. Without the nft tool the
+ * container couldn't have added any rules either, its image aside. */
+static int
+reset_nftables(const pool_reset_t *r)
+{
+    char *const argv[] = { "nft", "flush", "ruleset", NULL };
+    int err;
+
+    (void)r;
+
+    if (access("/sys/module/nf_tables", F_OK) < 0) return 0;
+
+    if ((err = run_tool(argv, "", FALSE)) == 127) return 0;
+
+    return err == 0 ? 0 : -1;
+}
+
+/* Reset steps in the order they run. Sysctls go after the links are
+ * set up again, e.g. the IPv6 MTU of veth1 can't be restored while the
+ * link MTU is still lower. */
+static const struct {
+    const char *name;
+    int (*fn)(const pool_reset_t *r);
+} pool_reset_steps[] = {
+    { "links",     reset_links },
+    { "addresses", reset_ip },
+    { "sysctls",   reset_sysctls },
+    { "ip6 rules", reset_ip6_rules },
+    { "qdiscs",    reset_qdiscs },
+    { "conntrack", reset_conntrack },
+    { "iptables",  reset_iptables },
+    { "nftables",  reset_nftables },
+};
+
+#define POOL_RESET_STEPS (int)(sizeof(pool_reset_steps) / sizeof(pool_reset_steps[0]))
+
+/* Run every reset step, run by netns_call(). */
+static int
+pool_reset_ns(void *arg)
+{
+    const pool_reset_t *r = (const pool_reset_t *)arg;
+    int i;
+
+    for (i = 0; i < POOL_RESET_STEPS; i++) {
+        if (pool_reset_steps[i].fn(r) < 0) {
+            fprintf(stderr, "Pool slot reset failed: %s\n", pool_reset_steps[i].name);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* Bring the namespace of the slot back to the state of a freshly
+ * created one. */
+static int
+pool_reset(int slot, int nsfd)
+{
+    char sysctls[PATH_MAX + 1];
+    char ip[IPLEN + 1];
+    pool_reset_t r = { ip, sysctls };
+
+    pool_path(slot, sysctls, ".sysctl");
+    pool_ip(slot, ip);
+
+    return netns_call(nsfd, pool_reset_ns, &r);
+}
+
+/* Remove whatever there is of the slot but the lock file, the veth
+ * pair goes with the namespace. Must be called with the slot locked. */
+static void
+pool_remove(int slot)
+{
+    char path[PATH_MAX + 1];
+    char *cmd;
+
+    asprintf(&cmd, "ip link delete vethpool%d 2>/dev/null", slot);
+    system(cmd);
+    free(cmd);
+
+    pool_path(slot, path, "");
+    if (umount2(path, MNT_DETACH) < 0 && errno != EINVAL && errno != ENOENT) {
+        die("umount pool slot");
+    }
+    unlink(path);
+
+    pool_path(slot, path, ".sysctl");
+    unlink(path);
+
+    pool_path(slot, path, ".sysctl.tmp");
+    unlink(path);
+
+    pool_path(slot, path, ".busy");
+    unlink(path);
+}
+
+/* Wiring of a new slot inside its namespace */
+typedef struct pool_wire {
+    int slot;
+    const char *ip;
+    const char *sysctls;
+    const char *tmp;
+} pool_wire_t;
+
+/* Name the peer veth1 as in any container, address it and take the
+ * sysctl snapshot, run by netns_call(). The snapshot only gets its
+ * name once complete as it marks the slot ready. */
+static int
+pool_wire_ns(void *arg)
+{
+    const pool_wire_t *w = (const pool_wire_t *)arg;
+
+    if (ip_batch("link set dev vpeer%d name veth1\n"
+                 "link set dev lo up\n"
+                 "link set dev veth1 up\n"
+                 POOL_ADDRESS_CMDS, w->slot, w->ip) < 0) return -1;
+
+    if (sysctl_save(w->tmp) < 0) return -1;
+
+    return rename(w->tmp, w->sysctls);
+}
+
+/* Create the namespace of the slot. A child unshare(2)s a new network
+ * namespace and waits until the parent bind mounts it, after that the
+ * child can go as the mount keeps the namespace alive. The veth pair
+ * is then wired the same way as for a single container, the peer is
+ * just named after the slot so slots can be created concurrently.
+ * Must be called with the slot locked. If the slot can't be wired up
+ * it is removed again, so a half made slot is never left behind.
+ */
+static int
+pool_create(int slot)
+{
+    char path[PATH_MAX + 1];
+    char nspath[PATH_MAX + 1];
+    char sysctls[PATH_MAX + 1];
+    char tmp[PATH_MAX + 1];
+    char ip[IPLEN + 1];
+    pool_wire_t w = { slot, ip, sysctls, tmp };
+    char *cmd;
+    int sync[2];
+    pid_t pid;
+    char ch;
+    int fd;
+    int err;
+
+    LOG("HOST| Creating network namespace pool slot %d", slot);
+
+    pool_path(slot, path, "");
+
+    /* Leftovers of an earlier attempt which didn't finish */
+    if (access(path, F_OK) == 0) pool_remove(slot);
+
+    if ((fd = open(path, O_RDONLY | O_CREAT | O_CLOEXEC, 0600)) < 0) die("create pool slot");
+    close(fd);
+
+    if (pipe(sync) == -1) die("pipe");
+
+    if ((pid = fork()) < 0) die("fork pool slot");
+
+    if (pid == 0) {
+        close(sync[0]);
+        if (unshare(CLONE_NEWNET) < 0) die("unshare netns");
+        write(sync[1], "x", 1);
+        pause();
+        _exit(EXIT_SUCCESS);
+    }
+
+    close(sync[1]);
+    if (read(sync[0], &ch, 1) != 1) die("pool slot child failed");
+    close(sync[0]);
+
+    snprintf(nspath, PATH_MAX, "/proc/%d/ns/net", pid);
+    err = mount(nspath, path, "none", MS_BIND, NULL);
+
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+
+    if (err < 0) die("bind mount netns");
+
+    pool_ip(slot, ip);
+    pool_path(slot, sysctls, ".sysctl");
+    pool_path(slot, tmp, ".sysctl.tmp");
+
+    asprintf(&cmd, "ip link add vethpool%d type veth peer name vpeer%d && "
+             "ip link set vethpool%d master %s && "
+             "ip link set vethpool%d up && "
+             "ip link set vpeer%d netns %s",
+             slot, slot, slot, BRIDGE, slot, slot, path);
+    err = system(cmd);
+    free(cmd);
+
+    if (err == 0) {
+        if ((fd = pool_open_ns(slot)) < 0) die("open pool slot");
+        err = netns_call(fd, pool_wire_ns, &w);
+        close(fd);
+    }
+
+    if (err != 0) {
+        fprintf(stderr, "Could not set up network namespace pool slot %d\n", slot);
+        pool_remove(slot);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Remove the slot with all its files. Must be called with the slot
+ * locked. */
+static void
+pool_destroy(int slot)
+{
+    char path[PATH_MAX + 1];
+
+    LOG("HOST| Destroying network namespace pool slot %d", slot);
+
+    pool_remove(slot);
+
+    pool_path(slot, path, ".lock");
+    unlink(path);
+}
+
+/* Claim a free slot for the container, creating a new one if all the
+ * existing ones are taken. Only the address changes if the container
+ * asked for a specific one. */
+static void
+pool_acquire(container_t *c)
+{
+    char busy[PATH_MAX + 1];
+    int slot, lock, fd;
+    int fresh = -1;
+    int fresh_lock = -1;
+
+    c->pool_slot = -1;
+
+    for (slot = 0; slot < POOL_MAX; slot++) {
+        /* Once there is an unused slot to fall back to only existing
+         * slots are interesting */
+        if (fresh >= 0 && !pool_exists(slot)) continue;
+
+        if ((lock = pool_lock(slot)) < 0) continue;
+
+        /* Only what is there under the lock counts, the slot could
+         * have been created or destroyed in the meantime */
+        if ((c->netns_fd = pool_open(slot)) >= 0) {
+            if (fresh_lock >= 0) close(fresh_lock);
+            c->pool_slot = slot;
+            c->pool_lock = lock;
+            break;
+        }
+
+        /* Remember the first unused slot in case nothing is free */
+        if (fresh < 0) {
+            fresh = slot;
+            fresh_lock = lock;
+        } else {
+            close(lock);
+        }
+    }
+
+    if (c->pool_slot < 0) {
+        if (fresh < 0) {
+            fprintf(stderr, "Network namespace pool exhausted\n");
+            exit(EXIT_FAILURE);
+        }
+        if (pool_create(fresh) < 0) exit(EXIT_FAILURE);
+        c->pool_slot = fresh;
+        c->pool_lock = fresh_lock;
+        if ((c->netns_fd = pool_open(fresh)) < 0) die("open pool slot");
+    }
+
+    LOG("HOST| Using network namespace pool slot %d", c->pool_slot);
+
+    /* The slot is marked busy until it is released, a marker left
+     * behind means diyc was killed and the slot was never reset. */
+    pool_path(c->pool_slot, busy, ".busy");
+    if (access(busy, F_OK) == 0) {
+        LOG("HOST| Pool slot %d was not released, resetting it", c->pool_slot);
+        if (pool_reset(c->pool_slot, c->netns_fd) < 0) {
+            close(c->netns_fd);
+            if (pool_create(c->pool_slot) < 0) exit(EXIT_FAILURE);
+            if ((c->netns_fd = pool_open(c->pool_slot)) < 0) die("open pool slot");
+        }
+    }
+    if ((fd = open(busy, O_WRONLY | O_CREAT | O_CLOEXEC, 0600)) < 0) die("pool slot busy");
+    close(fd);
+
+    /* The container inherits the lock and keeps the slot locked as
+     * long as it runs, even if diyc itself is gone. */
+    if (fcntl(c->pool_lock, F_SETFD, 0) < 0) die("pool lock");
+
+    if (c->ip[0] != '\0') {
+        if (pool_address(c->netns_fd, c->ip) < 0) die("pool address");
+    } else {
+        pool_ip(c->pool_slot, c->ip);
+    }
+}
+
+/* Put the slot back to the pool. Nothing the container did to the
+ * network may leak to the next one, so the namespace is reset to the
+ * state of a fresh slot, sysctls included. If that fails the slot is
+ * destroyed rather than handed over dirty. */
+static void
+pool_release(container_t *c)
+{
+    char busy[PATH_MAX + 1];
+
+    LOG("HOST| Recycling network namespace pool slot %d", c->pool_slot);
+
+    if (pool_reset(c->pool_slot, c->netns_fd) < 0) {
+        fprintf(stderr, "Could not reset network namespace pool slot %d, destroying it\n",
+                c->pool_slot);
+        pool_destroy(c->pool_slot);
+    } else {
+        pool_path(c->pool_slot, busy, ".busy");
+        unlink(busy);
+    }
+
+    close(c->netns_fd);
+    close(c->pool_lock);
+}
+
 /* Main container function which is responsible to set up the
  * environmnet for the main container process. This is the function
  * run by clone(2).
@@ -327,6 +1260,13 @@ container_exec(void *arg)
         die("Failure in child: read from pipe returned != 0\n");
     }
 
+    /* Join the pooled network namespace, it is already wired and
+     * addressed so there is nothing else to do for the network. */
+    if (c->netns_fd >= 0) {
+        LOG("CONTAINER| Joining pooled network namespace");
+        if (setns(c->netns_fd, CLONE_NEWNET) < 0) die("setns pooled netns");
+    }
+
     /* remount / as private, on some systems / is shared */
     if (mount("/", "/", "none", MS_PRIVATE | MS_REC, NULL) < 0 ) {
         die("mount / private");
@@ -397,7 +1337,7 @@ container_exec(void *arg)
      * route to the gateway, bridge diyc0 which has by default
      * 172.16.0.1. Again using ip tool and system() to avoid netlink
      * code. */
-    if (c->ip[0] != '\0') {
+    if (c->ip[0] != '\0' && c->netns_fd < 0) {
         char *ip_cmd;
 
         LOG("CONTAINER| Setting up network");
@@ -416,6 +1356,11 @@ container_exec(void *arg)
     /* Ready to execute the container command.*/
     LOG("CONTAINER| Executing command %s", c->args[0]);
 
+    /* Install the syscall filter as the very last thing, everything
+     * above needs syscalls the container command itself should not
+     * be allowed. */
+    if (c->seccomp.filter && seccomp_install(&c->seccomp) < 0) die("seccomp");
+
     err = execvp(c->args[0], c->args);
     if (0 != err) {
         printf("execvp error: %s\n", strerror(errno));
@@ -437,25 +1382,39 @@ main(int argc, char *argv[])
     pid_t pid = -1;
     struct clone_stack stack;
     char cgroup_dir[PATH_MAX + 1];
+    char seccomp_path[PATH_MAX + 1];
+    int pool = FALSE;
+    int pool_create_n = 0;
+    int pool_destroy_all = FALSE;
+    int slot;
 
     verbose = 0;
     memset(c.ip, 0, IPLEN);
+    c.pool_slot = -1;
+    c.pool_lock = -1;
+    c.netns_fd = -1;
 
     static const struct option long_opts[] = {
         { "help", no_argument, NULL, 'h' },
         { "ip", required_argument, NULL, 'i' },
         { "mem", required_argument, NULL, 'm' },
+        { "pool", no_argument, NULL, 'p' },
+        { "pool-create", required_argument, NULL, 'C' },
+        { "pool-destroy", no_argument, NULL, 'D' },
         { "verbose", no_argument, NULL, 'v' },
         { NULL, 0, NULL, 0 }
     };
 
     /* The + sign is for getopt to leave the extra arguments alone as
      * they belong to the executed command. see man 3 getopt_long*/
-    while ((opt = getopt_long(argc, argv,"+hvi:m:",
+    while ((opt = getopt_long(argc, argv,"+hpvi:m:",
                               long_opts, &long_index )) != -1) {
         switch (opt) {
         case 'i': strncpy(c.ip, optarg, IPLEN); break;
         case 'm': memory = atoi(optarg); break;
+        case 'p': pool = TRUE; break;
+        case 'C': pool_create_n = atoi(optarg); break;
+        case 'D': pool_destroy_all = TRUE; break;
         case 'v': verbose = TRUE; break;
         case 'h': usage(argv[0]); break;
         case '?':
@@ -463,6 +1422,56 @@ main(int argc, char *argv[])
         }
     }
 
+    if (NULL == getcwd(cwd, PATH_MAX)) die("getcwd()");
+
+    /* Pool management, no container is started. Slots in use are
+     * skipped by both. */
+    if (pool_create_n > 0) {
+        int created = 0;
+        int lock;
+
+        for (slot = 0; slot < POOL_MAX && created < pool_create_n; slot++) {
+            if (pool_exists(slot)) continue;
+            if ((lock = pool_lock(slot)) < 0) continue;
+
+            if (!pool_exists(slot)) {
+                if (pool_create(slot) < 0) exit(EXIT_FAILURE);
+                created++;
+            }
+            close(lock);
+        }
+
+        if (created < pool_create_n) {
+            fprintf(stderr, "Network namespace pool full, created %d of %d\n",
+                    created, pool_create_n);
+            exit(EXIT_FAILURE);
+        }
+        return 0;
+    }
+
+    if (pool_destroy_all) {
+        char path[PATH_MAX + 1];
+        char lock_path[PATH_MAX + 1];
+        int lock;
+
+        /* Half made slots have no snapshot, look for any file */
+        for (slot = 0; slot < POOL_MAX; slot++) {
+            pool_path(slot, path, "");
+            pool_path(slot, lock_path, ".lock");
+            if (access(path, F_OK) != 0 && access(lock_path, F_OK) != 0) continue;
+            if ((lock = pool_lock(slot)) < 0) continue;
+
+            pool_destroy(slot);
+            close(lock);
+        }
+        return 0;
+    }
+
+    if (c.ip[0] != '\0' && pool_ip_reserved(c.ip)) {
+        fprintf(stderr, "%s is reserved for the network namespace pool\n", c.ip);
+        exit(EXIT_FAILURE);
+    }
+
     if ((argc - optind) < 3) {
         printf("%d", (argc - optind));
         fprintf(stderr, "Not enough arguments\n");
@@ -478,8 +1487,6 @@ main(int argc, char *argv[])
      * proceed */
     if (pipe(c.pipe_fd) == -1) die("pipe");
 
-    if (NULL == getcwd(cwd, PATH_MAX)) die("getcwd()");
-
     /* Directory where the container filesystem will reside */
     if (snprintf(c.path,
                  PATH_MAX,
@@ -489,9 +1496,32 @@ main(int argc, char *argv[])
 
     LOG("HOST| Starting container %s using image %s", c.id, c.image);
 
+    /* Compile the seccomp profile of the image if there is one, the
+     * child only installs the ready program. */
+    c.seccomp.len = 0;
+    c.seccomp.filter = NULL;
+    if (snprintf(seccomp_path,
+                 PATH_MAX,
+                 "%s/images/%s.seccomp",
+                 cwd,
+                 c.image) >= PATH_MAX) die("snprintf: seccomp profile");
+
+    if (access(seccomp_path, R_OK) == 0) {
+        seccomp_profile_t profile;
+
+        if (seccomp_profile_load(seccomp_path, &profile) < 0) die(seccomp_path);
+        if (seccomp_compile(&profile, &c.seccomp) < 0) die("seccomp compile");
+
+        LOG("HOST| Seccomp profile %s: %d syscalls (%d hot), %d BPF instructions",
+            seccomp_path, profile.nallow, profile.nhot, c.seccomp.len);
+    }
+
     /* If the IP address is provided, we want to run in new network
-     * namespace and create the veth pair.  */
-    if (c.ip[0] != '\0')  {
+     * namespace and create the veth pair, unless the container takes
+     * one from the pool. */
+    if (pool) {
+        pool_acquire(&c);
+    } else if (c.ip[0] != '\0')  {
         flags |=  CLONE_NEWNET;
         create_peer(c.id);
     }
@@ -507,7 +1537,7 @@ main(int argc, char *argv[])
 
     /*If we have new network namespace add the veth1 to child's
      * namespace.*/
-    if (c.ip[0] != '\0') {
+    if (c.ip[0] != '\0' && !pool) {
         LOG("HOST| Network setup");
         network_setup(pid);
     }
@@ -529,6 +1559,11 @@ main(int argc, char *argv[])
         rmdir(cgroup_dir);
     }
 
+    /* Pooled network namespace is not destroyed, just cleaned up. */
+    if (pool) pool_release(&c);
+
+    free(c.seccomp.filter);
+
     LOG("HOST| Container exited");
     return 0;
 }
@@ -23,8 +23,10 @@
 #include <sched.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <time.h>
 #include <sys/wait.h>
 #include <sys/mount.h>
+#include <sys/mman.h>
 #include <signal.h>
 #include <fcntl.h>
 #include <stdio.h>
@@ -41,6 +43,14 @@
 # define TRUE 1
 #endif
 
+#ifndef CLONE_NEWCGROUP
+# define CLONE_NEWCGROUP 0x02000000
+#endif
+
+#ifndef CLONE_NEWTIME
+# define CLONE_NEWTIME 0x00000080
+#endif
+
 /* A simple error-handling function: print an error message based
    on the value in 'errno' and terminate the calling process */
 
@@ -64,6 +74,30 @@ struct clone_stack {
     char ptr[0];
 };
 
+/* Namespace combination measured in benchmark mode */
+struct bench_case {
+    const char *name;
+    int flags;
+};
+
+/* Default benchmark matrix, used if no namespace is selected */
+static const struct bench_case bench_cases[] = {
+    { "none",      0 },
+    { "mnt",       CLONE_NEWNS },
+    { "uts",       CLONE_NEWUTS },
+    { "ipc",       CLONE_NEWIPC },
+    { "pid",       CLONE_NEWPID },
+    { "net",       CLONE_NEWNET },
+    { "user",      CLONE_NEWUSER },
+    { "cgroup",    CLONE_NEWCGROUP },
+    { "time",      CLONE_NEWTIME },
+    { "container", CLONE_NEWNS | CLONE_NEWUTS | CLONE_NEWIPC | CLONE_NEWPID | CLONE_NEWNET },
+    { "all",       CLONE_NEWNS | CLONE_NEWUTS | CLONE_NEWIPC | CLONE_NEWPID | CLONE_NEWNET |
+                   CLONE_NEWUSER | CLONE_NEWCGROUP | CLONE_NEWTIME },
+};
+
+#define BENCH_CASES (int)(sizeof(bench_cases) / sizeof(bench_cases[0]))
+
 static int verbose;
 
 static void
@@ -75,14 +109,33 @@ usage(char *name)
     printf("\
     -h, --help           print this help\n");
     printf("\
+    -C, --cgroup         new cgroup namespace\n");
+    printf("\
+    -i, --ipc            new IPC namespace\n");
+    printf("\
+    -m, --mnt            new mount namespace, always used unless benchmarking\n");
+    printf("\
     -n, --net            new network namespace\n");
     printf("\
     -p, --pid            new PID namespace\n");
     printf("\
+    -T, --time           new time namespace\n");
+    printf("\
+    -U, --user           new user namespace, benchmark mode only as no uid\n\
+                         and gid maps are set up for CMD\n");
+    printf("\
     -u, --uts HOSTNAME   new UTS namespace\n");
     printf("\
     -v, --verbose        more verbose output\n\n");
     printf("\
+    -b, --bench N        instead of running CMD create and destroy the selected\n\
+                         namespaces N times and report latency percentiles and\n\
+                         throughput. Without any namespace selected every type\n\
+                         and some combinations are measured one by one\n");
+    printf("\
+    -j, --jobs N         number of parallel workers used in benchmark mode in\n\
+                         addition to the sequential run, default number of CPUs\n\n");
+    printf("\
     <CMD>                command to be executed\n");
 
     exit(EXIT_FAILURE);
@@ -127,13 +180,185 @@ childFunc(void *arg)
     return err;
 }
 
+static double
+now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int
+cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+/* Value at percentile p of the sorted samples */
+static double
+percentile(const double *v, int n, double p)
+{
+    return v[(int)(p * (n - 1) + 0.5)];
+}
+
+/* One benchmark worker, creates and destroys the namespaces
+ * iterations times. Every round forks a child which unshare(2)s the
+ * namespaces and exits right away, the last process leaving the
+ * namespaces frees them. unshare is used instead of clone as the
+ * time namespace can only be created that way. PID and time
+ * namespaces created by unshare are only entered by children, so
+ * for those the child also forks a grandchild, the pid 1 of the new
+ * namespace, and reaps it before exiting. Creation is timed by the
+ * child, after warming up, up to having the namespaces in use, teardown is the time from
+ * then to the parent reaping the child. The samples are stored in
+ * memory shared with the main process. Returns 0 or the errno of the
+ * failure. */
+static int
+bench_worker(int flags, int iterations, double *create, double *teardown)
+{
+    int i, status;
+    pid_t pid;
+
+    for (i = 0; i < iterations; i++) {
+        if ((pid = fork()) < 0) return errno;
+
+        if (pid == 0) {
+            double start;
+            pid_t init = -1;
+
+            /* The first memory writes and the first syscall after fork
+             * cost more than a cheap namespace, get them out of the way
+             * before the clock starts. */
+            create[i] = teardown[i] = now_us();
+            getppid();
+            start = now_us();
+
+            if (unshare(flags) < 0) _exit(errno);
+
+            if (flags & (CLONE_NEWPID | CLONE_NEWTIME)) {
+                if ((init = fork()) < 0) _exit(errno);
+                if (init == 0) _exit(EXIT_SUCCESS);
+            }
+
+            teardown[i] = now_us();
+            create[i] = teardown[i] - start;
+
+            if (init > 0 && waitpid(init, NULL, 0) == -1) _exit(errno);
+            _exit(EXIT_SUCCESS);
+        }
+
+        if (waitpid(pid, &status, 0) == -1) return errno;
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            return WIFEXITED(status) ? WEXITSTATUS(status) : ECHILD;
+        }
+        teardown[i] = now_us() - teardown[i];
+    }
+
+    return 0;
+}
+
+/* Run the workers in parallel and print one line of results. Netns
+ * and mount namespace teardown is partly deferred by the kernel, so
+ * under churn it shows up as lower throughput and slower creation
+ * rather than in the teardown latency itself. */
+static void
+bench_run(const char *name, int flags, int iterations, int jobs)
+{
+    int n = iterations * jobs;
+    size_t size = 2 * n * sizeof(double);
+    double *create, *teardown;
+    double start, elapsed;
+    int i, status, err = 0;
+    pid_t pid;
+
+    create = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (create == MAP_FAILED) die("mmap");
+    teardown = create + n;
+
+    start = now_us();
+
+    for (i = 0; i < jobs; i++) {
+        if ((pid = fork()) < 0) die("fork");
+
+        if (pid == 0) {
+            _exit(bench_worker(flags, iterations,
+                               create + i * iterations,
+                               teardown + i * iterations));
+        }
+    }
+
+    for (i = 0; i < jobs; i++) {
+        if (wait(&status) == -1) die("wait");
+        if (!WIFEXITED(status)) {
+            err = ECHILD;
+        } else if (WEXITSTATUS(status) != 0) {
+            err = WEXITSTATUS(status);
+        }
+    }
+
+    elapsed = now_us() - start;
+
+    if (err) {
+        printf("%-10s %4d  failed: %s\n", name, jobs, strerror(err));
+    } else {
+        qsort(create, n, sizeof(double), cmp_double);
+        qsort(teardown, n, sizeof(double), cmp_double);
+
+        printf("%-10s %4d  %8.1f %8.1f %8.1f %8.1f  %8.1f %8.1f %8.1f %8.1f  %10.0f\n",
+               name, jobs,
+               percentile(create, n, 0.5), percentile(create, n, 0.9),
+               percentile(create, n, 0.99), create[n - 1],
+               percentile(teardown, n, 0.5), percentile(teardown, n, 0.9),
+               percentile(teardown, n, 0.99), teardown[n - 1],
+               n / (elapsed / 1e6));
+    }
+    fflush(stdout);
+
+    munmap(create, size);
+}
+
+/* Benchmark mode, either the selected namespaces or the whole
+ * default matrix, each sequentially and with jobs parallel workers. */
+static void
+bench(int flags, int iterations, int jobs)
+{
+    struct bench_case selected = { "selected", flags };
+    int i;
+
+    printf("%d iterations per worker, latencies in us\n\n", iterations);
+    printf("%-10s %4s  %8s %8s %8s %8s  %8s %8s %8s %8s  %10s\n",
+           "namespaces", "jobs",
+           "create50", "90", "99", "max",
+           "down50", "90", "99", "max",
+           "ops/s");
+
+    for (i = 0; i < BENCH_CASES; i++) {
+        const struct bench_case *c = &bench_cases[i];
+
+        if (flags && i > 0) break;
+        if (flags) c = &selected;
+
+        bench_run(c->name, c->flags, iterations, 1);
+        if (jobs > 1) bench_run(c->name, c->flags, iterations, jobs);
+    }
+}
+
 
 int
 main(int argc, char *argv[])
 {
     int flags = SIGCHLD | CLONE_NEWNS;
+    int nsflags = 0;
     int long_index = 0;
     int opt;
+    int status;
+    int iterations = 0;
+    int jobs = sysconf(_SC_NPROCESSORS_ONLN);
     pid_t child_pid;
     struct child_args args;
     struct clone_stack stack;
@@ -144,20 +369,34 @@ main(int argc, char *argv[])
     /*COMMAND LINE ARGS*/
     static const struct option long_opts[] = {
         { "help", no_argument, NULL, 'h' },
+        { "bench", required_argument, NULL, 'b' },
+        { "cgroup", no_argument, NULL, 'C' },
+        { "ipc", no_argument, NULL, 'i' },
+        { "jobs", required_argument, NULL, 'j' },
+        { "mnt", no_argument, NULL, 'm' },
         { "net", no_argument, NULL, 'n' },
         { "pid", no_argument, NULL, 'p' },
+        { "time", no_argument, NULL, 'T' },
+        { "user", no_argument, NULL, 'U' },
         { "uts", required_argument, NULL, 'u' },
         { "verbose", no_argument, NULL, 'v' },
         { NULL, 0, NULL, 0 }
     };
 
-    while ((opt = getopt_long(argc, argv,"+inpu:v",
+    while ((opt = getopt_long(argc, argv,"+b:Cij:mnpTUu:v",
                               long_opts, &long_index )) != -1) {
         switch (opt) {
-        case 'n': flags |= CLONE_NEWNET;        break;
-        case 'p': flags |= CLONE_NEWPID;        break;
+        case 'b': iterations = atoi(optarg);    break;
+        case 'C': nsflags |= CLONE_NEWCGROUP;   break;
+        case 'i': nsflags |= CLONE_NEWIPC;      break;
+        case 'j': jobs = atoi(optarg);          break;
+        case 'm': nsflags |= CLONE_NEWNS;       break;
+        case 'n': nsflags |= CLONE_NEWNET;      break;
+        case 'p': nsflags |= CLONE_NEWPID;      break;
+        case 'T': nsflags |= CLONE_NEWTIME;     break;
+        case 'U': nsflags |= CLONE_NEWUSER;     break;
         case 'u':
-            flags |= CLONE_NEWUTS;
+            nsflags |= CLONE_NEWUTS;
             args.hostname = optarg;
             break;
         case 'v': verbose = TRUE;               break;
@@ -165,8 +404,31 @@ main(int argc, char *argv[])
         }
     }
 
+    if (iterations > 0) {
+        if (jobs < 1) jobs = 1;
+        bench(nsflags, iterations, jobs);
+        exit(EXIT_SUCCESS);
+    }
+
+    if (optind >= argc) usage(argv[0]);
+
+    /* Without uid/gid maps the child is nobody in the new user
+     * namespace and can't even remount /proc, so only benchmark it. */
+    if (nsflags & CLONE_NEWUSER) {
+        fprintf(stderr, "%s: -U is only supported with -b\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
     args.argv = &argv[optind];
 
+    /* The time namespace can't be created by clone(2), unshare(2)
+     * makes the children we are about to create enter a new one. */
+    if (nsflags & CLONE_NEWTIME) {
+        if (unshare(CLONE_NEWTIME) < 0) die("unshare time");
+        nsflags &= ~CLONE_NEWTIME;
+    }
+    flags |= nsflags;
+
     if (pipe(args.pipe_fd) == -1) die("pipe");
 
     child_pid = clone(childFunc, stack.ptr, flags, &args);
@@ -179,9 +441,10 @@ main(int argc, char *argv[])
     close(args.pipe_fd[1]);
 
     LOG("waiting for child to terminate\n");
-    if (waitpid(child_pid, NULL, 0) == -1) die("waitpid");
+    if (waitpid(child_pid, &status, 0) == -1) die("waitpid");
 
     LOG("%s: terminating\n", argv[0]);
 
-    exit(EXIT_SUCCESS);
+    /* Pass on the exit status of the command */
+    exit(WIFEXITED(status) ? WEXITSTATUS(status) : EXIT_FAILURE);
 }
@@ -0,0 +1,375 @@
+/* seccomp.c
+
+   diyc - seccomp-bpf profile loading and compilation
+   Copyright (C) 2017, 2018  Vilibald Wanča
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <linux/audit.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+
+#include "seccomp.h"
+
+#if defined(__x86_64__)
+# define SECCOMP_ARCH AUDIT_ARCH_X86_64
+#elif defined(__i386__)
+# define SECCOMP_ARCH AUDIT_ARCH_I386
+#elif defined(__aarch64__)
+# define SECCOMP_ARCH AUDIT_ARCH_AARCH64
+#elif defined(__arm__)
+# define SECCOMP_ARCH AUDIT_ARCH_ARM
+#else
+# error "seccomp: unsupported architecture"
+#endif
+
+/* Syscalls not in the allowlist fail with ENOSYS rather than killing
+ * the container. libc falls back to older syscalls only on ENOSYS, so
+ * a profile written before e.g. clone3 or openat2 existed keeps
+ * working for threaded and modern binaries. */
+#define RET_ALLOW SECCOMP_RET_ALLOW
+#define RET_DENY (SECCOMP_RET_ERRNO | (ENOSYS & SECCOMP_RET_DATA))
+
+/* Older headers only know the thread variant */
+#ifndef SECCOMP_RET_KILL_PROCESS
+# define SECCOMP_RET_KILL_PROCESS 0x80000000U
+#endif
+#define RET_KILL SECCOMP_RET_KILL_PROCESS
+
+#define X32_SYSCALL_BIT 0x40000000U
+
+/* Up to this many syscalls are compared linearly at the bottom of the
+ * search tree, splitting further does not pay off. */
+#define LEAF_MAX 4
+
+/* Conditional jumps in classic BPF have only 8 bit offsets. */
+#define JUMP_MAX 255
+
+/* Name to number table, generated by make from <sys/syscall.h>. */
+static const struct {
+    const char *name;
+    int nr;
+} syscall_names[] = {
+#define SYSCALL(n) { #n, __NR_##n },
+#include "syscalls.h"
+#undef SYSCALL
+};
+
+#define SYSCALL_NAMES (int)(sizeof(syscall_names) / sizeof(syscall_names[0]))
+
+/* Program being emitted */
+typedef struct bpf_buf {
+    struct sock_filter *insns;
+    int len;
+} bpf_buf_t;
+
+int
+seccomp_syscall_nr(const char *name)
+{
+    int i;
+
+    for (i = 0; i < SYSCALL_NAMES; i++) {
+        if (strcmp(syscall_names[i].name, name) == 0) return syscall_names[i].nr;
+    }
+
+    return -1;
+}
+
+int
+seccomp_syscall_count(void)
+{
+    return SYSCALL_NAMES;
+}
+
+const char *
+seccomp_syscall_name(int i)
+{
+    return (i >= 0 && i < SYSCALL_NAMES) ? syscall_names[i].name : NULL;
+}
+
+int
+seccomp_profile_add(seccomp_profile_t *p, int nr, int hot)
+{
+    int i;
+
+    for (i = 0; i < p->nallow; i++) {
+        if (p->allow[i] == nr) break;
+    }
+
+    if (i == p->nallow) {
+        if (p->nallow == SECCOMP_MAX_ALLOW) {
+            errno = ENOSPC;
+            return -1;
+        }
+        p->allow[p->nallow++] = nr;
+    }
+
+    if (!hot) return 0;
+
+    for (i = 0; i < p->nhot; i++) {
+        if (p->hot[i] == nr) return 0;
+    }
+
+    /* Too many hot syscalls, the rest is just found by the search. */
+    if (p->nhot < SECCOMP_MAX_HOT) p->hot[p->nhot++] = nr;
+
+    return 0;
+}
+
+int
+seccomp_profile_load(const char *path, seccomp_profile_t *p)
+{
+    FILE *fp;
+    char line[256];
+    int lineno = 0;
+
+    memset(p, 0, sizeof(*p));
+
+    if (NULL == (fp = fopen(path, "r"))) return -1;
+
+    while (fgets(line, sizeof(line), fp)) {
+        char *s = line;
+        char *e;
+        int hot = 0;
+        int nr;
+
+        lineno++;
+
+        if ((e = strchr(s, '#'))) *e = '\0';
+        while (isspace((unsigned char)*s)) s++;
+        e = s + strlen(s);
+        while (e > s && isspace((unsigned char)e[-1])) *--e = '\0';
+
+        if (*s == '\0') continue;
+
+        if (*s == '+') {
+            hot = 1;
+            s++;
+        }
+
+        /* Numbers are accepted too for syscalls the table doesn't know */
+        if (isdigit((unsigned char)*s)) {
+            nr = atoi(s);
+        } else {
+            nr = seccomp_syscall_nr(s);
+        }
+
+        if (nr < 0) {
+            fprintf(stderr, "%s:%d: unknown syscall '%s'\n", path, lineno, s);
+            fclose(fp);
+            errno = EINVAL;
+            return -1;
+        }
+
+        if (seccomp_profile_add(p, nr, hot) < 0) {
+            fclose(fp);
+            return -1;
+        }
+    }
+
+    fclose(fp);
+    return 0;
+}
+
+static void
+emit(bpf_buf_t *b, unsigned short code, unsigned int k,
+     unsigned char jt, unsigned char jf)
+{
+    struct sock_filter insn = { code, jt, jf, k };
+
+    b->insns[b->len++] = insn;
+}
+
+/* Validate the architecture and load the syscall number into the
+ * accumulator. Everything else kills the whole process, otherwise the
+ * syscall numbers of another ABI would be matched against ours. The
+ * process and not just the thread, a threaded program must not keep
+ * running with one of its threads silently gone. */
+static void
+emit_prologue(bpf_buf_t *b, int nocache)
+{
+    emit(b, BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, arch), 0, 0);
+    emit(b, BPF_JMP | BPF_JEQ | BPF_K, SECCOMP_ARCH, 1, 0);
+    emit(b, BPF_RET | BPF_K, RET_KILL, 0, 0);
+    /* The kernel caches the result for syscalls whose verdict only
+     * depends on arch and nr, touching anything else disables that. */
+    if (nocache) {
+        emit(b, BPF_LD | BPF_W | BPF_ABS,
+             offsetof(struct seccomp_data, instruction_pointer), 0, 0);
+    }
+    emit(b, BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, nr), 0, 0);
+#if defined(__x86_64__)
+    /* x32 syscalls share the arch with x86_64 and are told apart by
+     * bit 30 of the number. Numbers past the x32 range, like the -1
+     * of syscall(-1), are just unknown and fall through to ENOSYS. */
+    emit(b, BPF_JMP | BPF_JGE | BPF_K, X32_SYSCALL_BIT, 0, 2);
+    emit(b, BPF_JMP | BPF_JGE | BPF_K, X32_SYSCALL_BIT << 1, 1, 0);
+    emit(b, BPF_RET | BPF_K, RET_KILL, 0, 0);
+#endif
+}
+
+#if defined(__x86_64__)
+# define PROLOGUE_LEN(nocache) (7 + ((nocache) ? 1 : 0))
+#else
+# define PROLOGUE_LEN(nocache) (4 + ((nocache) ? 1 : 0))
+#endif
+
+/* Number of instructions emit_tree() produces for n syscalls. */
+static int
+tree_len(int n)
+{
+    int left;
+
+    if (n <= LEAF_MAX) return n + 2;
+
+    left = tree_len(n / 2);
+    return 1 + (left > JUMP_MAX ? 1 : 0) + left + tree_len(n - n / 2);
+}
+
+/* Emit a binary search over the sorted syscall numbers. Inner nodes
+ * split the range with a single JGE, leaves compare the few remaining
+ * numbers and carry their own return instructions so no jump ever has
+ * to reach the end of the program. */
+static void
+emit_tree(bpf_buf_t *b, const int *nrs, int n)
+{
+    int i, mid, left;
+
+    if (n <= LEAF_MAX) {
+        for (i = 0; i < n; i++) {
+            emit(b, BPF_JMP | BPF_JEQ | BPF_K, nrs[i], n - i, 0);
+        }
+        emit(b, BPF_RET | BPF_K, RET_DENY, 0, 0);
+        emit(b, BPF_RET | BPF_K, RET_ALLOW, 0, 0);
+        return;
+    }
+
+    mid = n / 2;
+    left = tree_len(mid);
+
+    if (left > JUMP_MAX) {
+        /* Too far for a conditional jump, bounce over an unconditional
+         * one which has a 32 bit offset. */
+        emit(b, BPF_JMP | BPF_JGE | BPF_K, nrs[mid], 0, 1);
+        emit(b, BPF_JMP | BPF_JA, left, 0, 0);
+    } else {
+        emit(b, BPF_JMP | BPF_JGE | BPF_K, nrs[mid], left, 0);
+    }
+
+    emit_tree(b, nrs, mid);
+    emit_tree(b, nrs + mid, n - mid);
+}
+
+static int
+cmp_int(const void *a, const void *b)
+{
+    int x = *(const int *)a;
+    int y = *(const int *)b;
+
+    return (x > y) - (x < y);
+}
+
+int
+seccomp_compile(const seccomp_profile_t *p, struct sock_fprog *prog)
+{
+    bpf_buf_t b = { NULL, 0 };
+    int rest[SECCOMP_MAX_ALLOW];
+    int nrest = 0;
+    int i, j, len;
+
+    /* Hot syscalls are already handled, keep them out of the tree */
+    for (i = 0; i < p->nallow; i++) {
+        for (j = 0; j < p->nhot; j++) {
+            if (p->hot[j] == p->allow[i]) break;
+        }
+        if (j == p->nhot) rest[nrest++] = p->allow[i];
+    }
+    qsort(rest, nrest, sizeof(int), cmp_int);
+
+    len = PROLOGUE_LEN(p->nocache) + (p->nhot ? p->nhot + 2 : 0) + tree_len(nrest);
+    if (len > BPF_MAXINSNS) {
+        errno = E2BIG;
+        return -1;
+    }
+
+    if (NULL == (b.insns = calloc(len, sizeof(struct sock_filter)))) return -1;
+
+    emit_prologue(&b, p->nocache);
+
+    /* Hot syscalls are compared one by one before the search and jump
+     * to a shared allow placed right after them. */
+    if (p->nhot) {
+        for (i = 0; i < p->nhot; i++) {
+            emit(&b, BPF_JMP | BPF_JEQ | BPF_K, p->hot[i], p->nhot - i, 0);
+        }
+        emit(&b, BPF_JMP | BPF_JA, 1, 0, 0);
+        emit(&b, BPF_RET | BPF_K, RET_ALLOW, 0, 0);
+    }
+
+    emit_tree(&b, rest, nrest);
+
+    prog->len = b.len;
+    prog->filter = b.insns;
+    return 0;
+}
+
+int
+seccomp_compile_linear(const seccomp_profile_t *p, struct sock_fprog *prog)
+{
+    bpf_buf_t b = { NULL, 0 };
+    int i, len;
+
+    len = PROLOGUE_LEN(p->nocache) + 2 * p->nallow + 1;
+    if (len > BPF_MAXINSNS) {
+        errno = E2BIG;
+        return -1;
+    }
+
+    if (NULL == (b.insns = calloc(len, sizeof(struct sock_filter)))) return -1;
+
+    emit_prologue(&b, p->nocache);
+
+    for (i = 0; i < p->nallow; i++) {
+        emit(&b, BPF_JMP | BPF_JEQ | BPF_K, p->allow[i], 0, 1);
+        emit(&b, BPF_RET | BPF_K, RET_ALLOW, 0, 0);
+    }
+    emit(&b, BPF_RET | BPF_K, RET_DENY, 0, 0);
+
+    prog->len = b.len;
+    prog->filter = b.insns;
+    return 0;
+}
+
+int
+seccomp_install(struct sock_fprog *prog)
+{
+    if (prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, prog) == 0) return 0;
+
+    /* Without CAP_SYS_ADMIN the kernel insists on no_new_privs */
+    if (errno != EACCES) return -1;
+    if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) < 0) return -1;
+
+    return prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, prog);
+}
@@ -0,0 +1,66 @@
+/* seccomp.h
+
+   diyc - seccomp-bpf profile loading and compilation
+   Copyright (C) 2017, 2018  Vilibald Wanča
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#ifndef DIYC_SECCOMP_H
+#define DIYC_SECCOMP_H
+
+#include <linux/filter.h>
+
+#define SECCOMP_MAX_HOT 32
+#define SECCOMP_MAX_ALLOW 1024
+
+/* Allowlist profile. Hot syscalls are kept separately, in the order
+ * they appear in the profile, as they are checked first. */
+typedef struct seccomp_profile {
+    int hot[SECCOMP_MAX_HOT]; /* Hot syscall numbers, checked linearly first */
+    int nhot;
+    int allow[SECCOMP_MAX_ALLOW]; /* All allowed syscall numbers incl. hot */
+    int nallow;
+    int nocache; /* Defeat the kernel's result cache, for benchmarking */
+} seccomp_profile_t;
+
+/* Translate syscall name to its number, -1 if unknown. */
+int seccomp_syscall_nr(const char *name);
+
+/* Number of syscalls known to the name table and the name at index i,
+ * handy for building a profile allowing everything. */
+int seccomp_syscall_count(void);
+const char *seccomp_syscall_name(int i);
+
+/* Add a syscall to the profile, hot ones go to the hot list as well. */
+int seccomp_profile_add(seccomp_profile_t *p, int nr, int hot);
+
+/* Read the allowlist file. One syscall per line, '#' starts a comment
+ * and a '+' prefix marks the syscall as hot. Returns -1 and sets
+ * errno on failure. */
+int seccomp_profile_load(const char *path, seccomp_profile_t *p);
+
+/* Compile the profile into a BPF program with hot syscalls checked
+ * first followed by a binary search over the rest. */
+int seccomp_compile(const seccomp_profile_t *p, struct sock_fprog *prog);
+
+/* Compile the profile into a naive linear chain of comparisons, used
+ * only as a baseline for benchmarking. */
+int seccomp_compile_linear(const seccomp_profile_t *p, struct sock_fprog *prog);
+
+/* Install the program for the calling process. */
+int seccomp_install(struct sock_fprog *prog);
+
+#endif /* DIYC_SECCOMP_H */
@@ -0,0 +1,245 @@
+/* seccomp_bench.c
+
+   Measure the per-syscall overhead of the seccomp filters diyc
+   compiles, compared to no filter and a naive linear filter.
+   Copyright (C) 2017, 2018  Vilibald Wanča
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+
+#include "seccomp.h"
+
+#define die(msg)                            \
+do {                                        \
+    perror(msg);                            \
+    exit(EXIT_FAILURE);                     \
+} while (0)
+
+enum kind { KIND_NONE, KIND_LINEAR, KIND_TREE };
+
+/* Filter variant to measure */
+struct mode {
+    const char *name;
+    enum kind kind;
+    int hot;     /* Measured syscall is hot */
+    int nocache; /* Program can't be cached by the kernel */
+};
+
+/* The cached variants show what a container really pays on kernels
+ * with the seccomp action cache (5.11+), the uncached ones actually
+ * run the program on every syscall and so compare linear and tree. */
+static const struct mode modes[] = {
+    { "none",        KIND_NONE,   0, 0 },
+    { "linear",      KIND_LINEAR, 0, 0 },
+    { "tree",        KIND_TREE,   0, 0 },
+    { "tree+hot",    KIND_TREE,   1, 0 },
+    { "linear/nc",   KIND_LINEAR, 0, 1 },
+    { "tree/nc",     KIND_TREE,   0, 1 },
+    { "tree+hot/nc", KIND_TREE,   1, 1 },
+};
+
+#define MODES (int)(sizeof(modes) / sizeof(modes[0]))
+
+static void
+usage(char *name)
+{
+    printf("Measure per-syscall overhead of seccomp filters.\n");
+    printf("Usage: %s [OPTIONS]\n\n", name);
+
+    printf("\
+    -h, --help           print this help\n");
+    printf("\
+    -d, --denied         measure the syscall denied by the filter instead of\n\
+                         allowed, denials are never cached by the kernel\n");
+    printf("\
+    -n, --iterations N   number of syscalls per run, default 1000000\n");
+    printf("\
+    -p, --profile FILE   allowlist profile, default allows every known syscall\n");
+    printf("\
+    -s, --syscall NAME   syscall to measure, default getppid. It is called\n\
+                         with -1 and zeros as arguments\n");
+
+    exit(EXIT_FAILURE);
+}
+
+static double
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Run the measurement in a child as a filter can never be removed
+ * once installed. The child reports ns per syscall through a pipe. */
+static double
+run(const struct mode *m, const seccomp_profile_t *p, int nr,
+    long iterations, int *insns)
+{
+    struct sock_fprog prog = { 0, NULL };
+    seccomp_profile_t mp = *p;
+    int fd[2];
+    pid_t pid;
+    double result = -1;
+    long i;
+
+    mp.nocache = m->nocache;
+    if (m->hot) seccomp_profile_add(&mp, nr, 1);
+
+    if (m->kind == KIND_LINEAR) {
+        if (seccomp_compile_linear(&mp, &prog) < 0) die("seccomp_compile_linear");
+    } else if (m->kind == KIND_TREE) {
+        if (seccomp_compile(&mp, &prog) < 0) die("seccomp_compile");
+    }
+    *insns = prog.len;
+
+    if (pipe(fd) == -1) die("pipe");
+
+    if ((pid = fork()) < 0) die("fork");
+
+    if (pid == 0) {
+        double start;
+
+        close(fd[0]);
+        if (prog.filter && seccomp_install(&prog) < 0) die("seccomp_install");
+
+        /* Harmless arguments, read/write/close on -1 just fail with
+         * EBADF instead of blocking or closing our pipe. */
+        start = now_ns();
+        for (i = 0; i < iterations; i++) {
+            syscall(nr, -1, NULL, 0, 0, 0, 0);
+        }
+        result = (now_ns() - start) / iterations;
+
+        write(fd[1], &result, sizeof(result));
+        _exit(EXIT_SUCCESS);
+    }
+
+    close(fd[1]);
+    if (read(fd[0], &result, sizeof(result)) != sizeof(result)) result = -1;
+    close(fd[0]);
+    if (waitpid(pid, NULL, 0) == -1) die("waitpid");
+
+    free(prog.filter);
+    return result;
+}
+
+int
+main(int argc, char *argv[])
+{
+    int opt;
+    int long_index = 0;
+    long iterations = 1000000;
+    char *profile = NULL;
+    char *name = "getppid";
+    int denied = 0;
+    seccomp_profile_t p;
+    double base = 0;
+    int nr, i, j, insns;
+
+    static const struct option long_opts[] = {
+        { "help", no_argument, NULL, 'h' },
+        { "denied", no_argument, NULL, 'd' },
+        { "iterations", required_argument, NULL, 'n' },
+        { "profile", required_argument, NULL, 'p' },
+        { "syscall", required_argument, NULL, 's' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    while ((opt = getopt_long(argc, argv, "hdn:p:s:",
+                              long_opts, &long_index)) != -1) {
+        switch (opt) {
+        case 'd': denied = 1; break;
+        case 'n': iterations = atol(optarg); break;
+        case 'p': profile = optarg; break;
+        case 's': name = optarg; break;
+        default: usage(argv[0]);
+        }
+    }
+
+    if (iterations <= 0) usage(argv[0]);
+
+    if ((nr = seccomp_syscall_nr(name)) < 0) {
+        fprintf(stderr, "Unknown syscall %s\n", name);
+        exit(EXIT_FAILURE);
+    }
+
+    if (denied && (nr == SYS_write || nr == SYS_exit_group || nr == SYS_clock_gettime)) {
+        fprintf(stderr, "%s is needed by the benchmark itself\n", name);
+        exit(EXIT_FAILURE);
+    }
+
+    if (profile) {
+        if (seccomp_profile_load(profile, &p) < 0) die(profile);
+    } else {
+        memset(&p, 0, sizeof(p));
+        for (i = 0; i < seccomp_syscall_count(); i++) {
+            seccomp_profile_add(&p, seccomp_syscall_nr(seccomp_syscall_name(i)), 0);
+        }
+    }
+
+    /* The benchmark itself has to survive the filter. */
+    seccomp_profile_add(&p, SYS_write, 0);
+    seccomp_profile_add(&p, SYS_exit_group, 0);
+    seccomp_profile_add(&p, SYS_clock_gettime, 0);
+
+    if (denied) {
+        /* Take the syscall out, the filter has to walk to the end */
+        for (i = j = 0; i < p.nallow; i++) {
+            if (p.allow[i] != nr) p.allow[j++] = p.allow[i];
+        }
+        p.nallow = j;
+        for (i = j = 0; i < p.nhot; i++) {
+            if (p.hot[i] != nr) p.hot[j++] = p.hot[i];
+        }
+        p.nhot = j;
+    } else {
+        seccomp_profile_add(&p, nr, 0);
+    }
+
+    printf("syscall %s (%d) %s, %d allowed syscalls, %ld iterations\n",
+           name, nr, denied ? "denied" : "allowed", p.nallow, iterations);
+    printf("/nc filters can't be cached by the kernel and always run\n\n");
+    printf("%-12s %8s %12s %12s\n", "filter", "insns", "ns/syscall", "overhead");
+
+    for (i = 0; i < MODES; i++) {
+        double ns;
+
+        /* Hot would make the denied syscall allowed */
+        if (denied && modes[i].hot) continue;
+
+        ns = run(&modes[i], &p, nr, iterations, &insns);
+        if (ns < 0) {
+            printf("%-12s %8d %12s\n", modes[i].name, insns, "failed");
+            continue;
+        }
+        if (modes[i].kind == KIND_NONE) base = ns;
+        printf("%-12s %8d %12.1f %12.1f\n", modes[i].name, insns, ns, ns - base);
+    }
+
+    exit(EXIT_SUCCESS);
+}